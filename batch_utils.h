@@ -0,0 +1,231 @@
+#ifndef batch_utils_h
+#define batch_utils_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "conv_utils.h"
+
+namespace cu {
+    
+    // blocking queue of bounded capacity to apply backpressure between stages
+    template<class T>
+    class bounded_queue{
+        
+        // queued items and maximum number of them
+        std::deque<T> items;
+        size_t capacity;
+        
+        // set once the producer is done or the batch is aborted
+        bool closed;
+        
+        std::mutex lock;
+        std::condition_variable not_empty, not_full;
+    
+    public:
+        
+        bounded_queue(size_t _capacity) : capacity(std::max(_capacity, (size_t) 1)), closed(false) {}
+        
+        
+        // wait for space and add an item; returns false if the queue was closed
+        bool push(T item) {
+            std::unique_lock<std::mutex> guard(lock);
+            not_full.wait(guard, [this] { return closed || items.size() < capacity; });
+            if (closed) return false;
+            items.push_back(std::move(item));
+            not_empty.notify_one();
+            return true;
+        }
+        
+        
+        // wait for an item and remove it; returns false once closed and drained
+        bool pop(T &item) {
+            std::unique_lock<std::mutex> guard(lock);
+            not_empty.wait(guard, [this] { return closed || items.size() > 0; });
+            if (items.size() == 0) return false;
+            item = std::move(items.front());
+            items.pop_front();
+            not_full.notify_one();
+            return true;
+        }
+        
+        
+        // no more items will be pushed
+        void close() {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+            not_empty.notify_all();
+            not_full.notify_all();
+        }
+        
+        
+        // drop queued items and release producers and consumers on either side
+        void abort() {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+            items.clear();
+            not_empty.notify_all();
+            not_full.notify_all();
+        }
+    };
+    
+    
+    
+    
+    // read a whitespace separated image, row by row for each channel
+    // returns NULL if the stream ends before the image starts, and throws if it ends partway through
+    template<class T>
+    std::unique_ptr<image_tensor<T> > read_image(std::istream &in, int rows, int cols, int channels = 1) {
+        std::unique_ptr<image_tensor<T> > image(new image_tensor<T>(rows, cols, channels));
+        for (size_t i = 0; i < image->size(); i++) {
+            if (!(in >> image->data[i])) {
+                if (i == 0) return NULL;
+                throw std::runtime_error("[Batch error] image data ends partway through a frame.");
+            }
+        }
+        return image;
+    }
+    
+    
+    
+    
+    // convolves a stream of images with a fixed filter, overlapping load, preparation, convolution and output
+    template<class T>
+    class batch_pipeline{
+        
+        // image travelling through the stages along with its position in the batch
+        typedef std::pair<size_t, std::unique_ptr<image_tensor<T> > > batch_item;
+        
+        // stage callbacks
+        typedef std::function<std::unique_ptr<image_tensor<T> >()> load_stage;
+        typedef std::function<void(image_tensor<T>&)> prepare_stage;
+        typedef std::function<void(size_t, image_tensor<T>&)> sink_stage;
+        
+        // filter shared read-only by the convolution workers
+        filter_tensor<T>* filter;
+        
+        // capacity of each queue between stages and number of convolution workers
+        size_t queue_capacity;
+        int conv_workers;
+        
+        // convolve a prepared image into a new output image; throws if the image does not fit the filter
+        std::unique_ptr<image_tensor<T> > convolve(const matrix2D<T> &filter_mat, image_tensor<T> &conv_input_image) const {
+            if (conv_input_image.get_channels() != filter->get_ichannels()) {
+                throw std::invalid_argument("[Batch error] image channels do not match the filter input channels.");
+            }
+            
+            if (conv_input_image.get_rows() < filter->get_irows() || conv_input_image.get_cols() < filter->get_icols()) {
+                throw std::invalid_argument("[Batch error] prepared image is smaller than the filter.");
+            }
+            
+            std::unique_ptr<image_tensor<T> > conv_output_image(new image_tensor<T>(conv_input_image.get_rows() - filter->get_irows() + 1,
+                                                                                 conv_input_image.get_cols() - filter->get_icols() + 1,
+                                                                                 filter->get_ochannels()));
+            matrix2D<T> input_mat(conv_input_image, *filter);
+            matrix2D<T> output_mat(*conv_output_image);
+            mult_matrix2D(filter_mat, input_mat, output_mat);
+            return conv_output_image;
+        }
+    
+    public:
+        
+        batch_pipeline(filter_tensor<T> &_filter, size_t _queue_capacity = 4, int _conv_workers = 1) :
+        filter(&_filter),
+        queue_capacity(std::max(_queue_capacity, (size_t) 1)),
+        conv_workers(std::max(_conv_workers, 1)) {}
+        
+        
+        // run the batch until load returns NULL; the sink is called on this thread, in completion order
+        // an exception thrown by any stage aborts the batch and is rethrown here once all workers have stopped
+        void run(load_stage load, prepare_stage prepare, sink_stage sink) {
+            bounded_queue<batch_item> loaded(queue_capacity), prepared(queue_capacity), convolved(queue_capacity);
+            
+            // the first exception raised by a stage, after which every queue is aborted
+            std::exception_ptr error;
+            std::mutex error_lock;
+            auto fail = [&] {
+                {
+                    std::lock_guard<std::mutex> guard(error_lock);
+                    if (!error) error = std::current_exception();
+                }
+                loaded.abort();
+                prepared.abort();
+                convolved.abort();
+            };
+            
+            // the filter matrix is set up once, before the workers share it
+            matrix2D<T> filter_mat(*filter);
+            
+            std::vector<std::thread> workers;
+            std::atomic<int> remaining(conv_workers);
+            try {
+                // load images in order
+                workers.emplace_back([&] {
+                    try {
+                        size_t index = 0;
+                        for (std::unique_ptr<image_tensor<T> > image = load(); image; image = load()) {
+                            if (!loaded.push(batch_item(index++, std::move(image)))) break;
+                        }
+                    } catch (...) {
+                        fail();
+                    }
+                    loaded.close();
+                });
+                
+                // pad or otherwise set up the lineage of each image
+                workers.emplace_back([&] {
+                    try {
+                        batch_item item;
+                        while (loaded.pop(item)) {
+                            prepare(*item.second);
+                            if (!prepared.push(std::move(item))) break;
+                        }
+                    } catch (...) {
+                        fail();
+                    }
+                    prepared.close();
+                });
+                
+                // convolve on as many workers as requested; the last one to finish closes the output queue
+                for (int w = 0; w < conv_workers; w++) {
+                    workers.emplace_back([&] {
+                        try {
+                            batch_item item;
+                            while (prepared.pop(item)) {
+                                item.second = convolve(filter_mat, *item.second);
+                                if (!convolved.push(std::move(item))) break;
+                            }
+                        } catch (...) {
+                            fail();
+                        }
+                        if (--remaining == 0) convolved.close();
+                    });
+                }
+                
+                // emit results
+                batch_item item;
+                while (convolved.pop(item)) {
+                    sink(item.first, *item.second);
+                }
+            } catch (...) {
+                fail();
+            }
+            
+            for (size_t w = 0; w < workers.size(); w++) workers[w].join();
+            if (error) std::rethrow_exception(error);
+        }
+    
+    };
+
+
+};
+
+#endif /* batch_utils_h */
@@ -2,6 +2,7 @@
 #define conv_utils_h
 
 #include <vector>
+#include <algorithm>
 #include "tensor.h"
 #include <unordered_set>
 
@@ -55,11 +56,14 @@ namespace cu {
         // constructor useful for image tensors
         mat_interpretable_tensor(int a, int b, int c, int d) : tensor<T>(a, b, c, d) {}
         
+        // constructor useful for image tensors viewing an external buffer
+        mat_interpretable_tensor(T* buffer, int a, int b, int c, int d) : tensor<T>(buffer, a, b, c, d) {}
+        
         // constructor useful for filter tensors
         mat_interpretable_tensor(int a, int b, int c, int d, int e) : tensor<T>(a, b, c, d, e) {}
         
         // must maintain row and column size of interpreted matrix
-        int mat_rows, mat_cols;
+        int mat_rows = 0, mat_cols = 0;
         
         // must provide a value of interpreted matrix
         virtual T mat_value_at(int r, int c) const = 0;
@@ -141,6 +145,13 @@ namespace cu {
         cols(_cols),
         channels(_channels) {}
         
+        // an image tensor over an external buffer of at least rows * cols * channels values, which it does not own
+        image_tensor(T* buffer, int _rows, int _cols, int _channels = 1) :
+        mat_interpretable_tensor<T>(buffer, 3, _channels, _rows, _cols),
+        rows(_rows),
+        cols(_cols),
+        channels(_channels) {}
+        
         
         // for indexing to values in filter tensor's current state, regardless of any operations performed on it
         T at(int channel, int row, int col) const {
@@ -193,6 +204,50 @@ namespace cu {
         }
         
         
+        // map an inclusive rectangle of the original image through its lineage; returns false if nothing survives
+        bool map_region(int &left, int &top, int &right, int &bottom) const {
+            // clip to the original image
+            top = std::max(top, 0);
+            left = std::max(left, 0);
+            bottom = std::min(bottom, rows - 1);
+            right = std::min(right, cols - 1);
+            
+            for(size_t i = 0; i < img_ops.size() && top <= bottom && left <= right; i++){
+                const operation &op = img_ops[i].second;
+                
+                // padding shifts the region
+                if(op.op == operation::PADZERO){
+                    top += op.top;
+                    left += op.left;
+                    bottom += op.top;
+                    right += op.left;
+                }
+                
+                // upsampling spreads the region over the scaled indices
+                else if(op.op == operation::UPSAMPLE){
+                    top *= op.scaleY;
+                    left *= op.scaleX;
+                    bottom *= op.scaleY;
+                    right *= op.scaleX;
+                }
+                
+                // downsampling keeps only the sampled indices within the region
+                else if(op.op == operation::DOWNSAMPLE){
+                    top = (top + op.scaleY - 1) / op.scaleY;
+                    left = (left + op.scaleX - 1) / op.scaleX;
+                    bottom = bottom / op.scaleY;
+                    right = right / op.scaleX;
+                }
+                
+                // clip to the image size after the operation
+                bottom = std::min(bottom, img_ops[i].first.first - 1);
+                right = std::min(right, img_ops[i].first.second - 1);
+            }
+            
+            return top <= bottom && left <= right;
+        }
+        
+        
         // return Topelitz matrix interpreted value of input image (along with filter)
         T mat_value_at(int r, int c) const {
             // extract channel info from r
@@ -210,7 +265,7 @@ namespace cu {
             return at(channel, origin_i + offset_i, origin_j + offset_j);
         }
         
-        int fr, fc, fi, fo, outr, outc;
+        int fr = 0, fc = 0, fi = 0, fo = 0, outr = 0, outc = 0;
         
         
         // displays the image tensor
@@ -390,6 +445,11 @@ namespace cu {
             return _from_tensor->mat_cols;
         }
         
+        // whether the matrix is interpreted from the given tensor
+        bool interprets(const mat_interpretable_tensor<T> &from_tensor) const {
+            return _from_tensor == &from_tensor;
+        }
+        
         
         // for initializing filter matrix
         matrix2D(filter_tensor<T> &conv_filter) : _from_tensor(&conv_filter) {
@@ -433,30 +493,315 @@ namespace cu {
     
     
     
-    // utility to multiply two interpreted matrices
+    // check that two interpreted matrices can be multiplied into the output
     template<class T>
-    void mult_matrix2D(const matrix2D<T> &m1, const matrix2D<T> &m2, matrix2D<T> out) {
+    bool check_matrix2D(const matrix2D<T> &m1, const matrix2D<T> &m2, const matrix2D<T> &out, const char* error) {
         if (out.get_rows() != m1.get_rows() || out.get_cols() != m2.get_cols()) {
-            std::cout << "[Matrix multiplication error] output dimensions do not match.\n";
-            return;
+            std::cout << "[" << error << "] output dimensions do not match.\n";
+            return false;
         }
         
         if (m1.get_cols() != m2.get_rows()) {
-            std::cout << "[Matrix multiplication error] input matrices dimensions are incompatible.\n";
-            return;
+            std::cout << "[" << error << "] input matrices dimensions are incompatible.\n";
+            return false;
         }
         
+        return true;
+    }
+    
+    
+    // inner product of a row of the first matrix with a column of the second
+    template<class T>
+    T inner_matrix2D(const matrix2D<T> &m1, const matrix2D<T> &m2, int i, int j) {
+        T value = 0;
+        for (int k = 0; k < m1.get_cols(); k++) {
+            value += m1.mat_at(i, k) * m2.mat_at(k, j);
+        }
+        return value;
+    }
+    
+    
+    // utility to multiply two interpreted matrices
+    template<class T>
+    void mult_matrix2D(const matrix2D<T> &m1, const matrix2D<T> &m2, matrix2D<T> out) {
+        if (!check_matrix2D(m1, m2, out, "Matrix multiplication error")) return;
+        
         for (int i = 0; i < m1.get_rows(); i++) {
             for (int j = 0; j < m2.get_cols(); j++) {
-                out.at(i, j) = 0;
-                for (int k = 0; k < m1.get_cols(); k++) {
-                    out.at(i, j) += m1.mat_at(i, k) * m2.mat_at(k, j);
+                out.at(i, j) = inner_matrix2D(m1, m2, i, j);
+            }
+        }
+    }
+    
+    
+    
+    // recompute only the outputs affected by a dirty rectangle (inclusive, original image coordinates) of the input image behind m2
+    template<class T>
+    void update_matrix2D(const matrix2D<T> &m1, const matrix2D<T> &m2, matrix2D<T> out, const image_tensor<T> &conv_input_image,
+                         int left, int top, int right, int bottom) {
+        if (!check_matrix2D(m1, m2, out, "Matrix update error")) return;
+        
+        if (!m2.interprets(conv_input_image)) {
+            std::cout << "[Matrix update error] input image is not the one interpreted by the Toeplitz matrix.\n";
+            return;
+        }
+        
+        // find the dirty region in the current state of the input image
+        if (!conv_input_image.map_region(left, top, right, bottom)) return;
+        
+        // every output whose filter window overlaps the dirty region
+        int outr = conv_input_image.outr, outc = conv_input_image.outc;
+        int row_begin = std::max(top - conv_input_image.fr + 1, 0), row_end = std::min(bottom, outr - 1);
+        int col_begin = std::max(left - conv_input_image.fc + 1, 0), col_end = std::min(right, outc - 1);
+        
+        for (int i = 0; i < m1.get_rows(); i++) {
+            for (int orow = row_begin; orow <= row_end; orow++) {
+                for (int ocol = col_begin; ocol <= col_end; ocol++) {
+                    out.at(i, orow * outc + ocol) = inner_matrix2D(m1, m2, i, orow * outc + ocol);
                 }
             }
         }
     }
     
     
+    
+    // struct encompassing convolution layer details
+    template<class T>
+    struct conv_layer{
+        
+        // activations that may follow the convolution
+        typedef enum activation_type {
+            NONE,
+            RELU
+        } activation_type;
+        
+        // filter of the layer, owned by the caller
+        filter_tensor<T>* filter;
+        
+        // padding of the input, dilation of the filter and stride of the output
+        int left, top, right, bottom;
+        int dilationX, dilationY;
+        int strideX, strideY;
+        activation_type activation;
+        
+        // filter size the layer was planned with, and the planned output size before the stride is applied
+        int filter_rows, filter_cols;
+        int out_rows, out_cols;
+        
+        // pass the padding, dilation and stride as array-style lists
+        conv_layer(filter_tensor<T> &_filter, std::vector<int> padding, std::vector<int> dilation, std::vector<int> stride, activation_type _activation) :
+        filter(&_filter),
+        left(padding[0]), top(padding[1]), right(padding[2]), bottom(padding[3]),
+        dilationX(dilation[0]), dilationY(dilation[1]),
+        strideX(stride[0]), strideY(stride[1]),
+        activation(_activation),
+        filter_rows(_filter.get_irows()), filter_cols(_filter.get_icols()),
+        out_rows(0), out_cols(0) {}
+    };
+    
+    
+    
+    
+    // sequence of convolution layers run out of a single ping-pong arena
+    template<class T>
+    class conv_pipeline{
+        
+        // shape of the input image
+        int in_rows, in_cols, in_channels;
+        
+        // layers in order of execution
+        std::vector<conv_layer<T> > layers;
+        
+        // each activation is only live until the next layer consumes it, so alternate layers share a slot
+        std::vector<T> arena;
+        
+        // an unstrided last layer writes straight into the output and needs no slot
+        size_t arena_layers() const {
+            if (layers.size() == 0) return 0;
+            return (layers.back().strideX == 1 && layers.back().strideY == 1) ? layers.size() - 1 : layers.size();
+        }
+        
+        // largest activation kept in the slot of even (0) or odd (1) layers
+        size_t slot_size(size_t parity) const {
+            size_t size = 0;
+            for (size_t k = parity; k < arena_layers(); k += 2) {
+                size = std::max(size, (size_t) layers[k].out_rows * layers[k].out_cols * layers[k].filter->get_ochannels());
+            }
+            return size;
+        }
+        
+        // start of the slot holding the output of layer k
+        T* slot(size_t k) {
+            return arena.data() + ((k % 2 == 0) ? 0 : slot_size(0));
+        }
+        
+        // convolve an input image into the given buffer according to layer details
+        void run_layer(conv_layer<T> &layer, image_tensor<T> &conv_input_image, T* buffer) {
+            // the Toeplitz matrix overwrites the interpretation of the input, so keep any the caller built over it
+            int fr = conv_input_image.fr, fc = conv_input_image.fc, fi = conv_input_image.fi, fo = conv_input_image.fo;
+            int outr = conv_input_image.outr, outc = conv_input_image.outc;
+            int mat_rows = conv_input_image.mat_rows, mat_cols = conv_input_image.mat_cols;
+            
+            conv_input_image.pad_image(layer.left, layer.top, layer.right, layer.bottom);
+            layer.filter->upsample_filter(layer.dilationX, layer.dilationY);
+            
+            // multiply the interpreted matrices into the layer output
+            image_tensor<T> conv_output_image(buffer, layer.out_rows, layer.out_cols, layer.filter->get_ochannels());
+            matrix2D<T> filter_mat(*layer.filter);
+            matrix2D<T> input_mat(conv_input_image, *layer.filter);
+            matrix2D<T> output_mat(conv_output_image);
+            mult_matrix2D(filter_mat, input_mat, output_mat);
+            
+            // apply the activation in place
+            if (layer.activation == conv_layer<T>::RELU) {
+                for (size_t i = 0; i < conv_output_image.size(); i++) {
+                    if (buffer[i] < 0) buffer[i] = 0;
+                }
+            }
+            
+            // restore the caller's input and filter
+            layer.filter->undo_operation();
+            conv_input_image.undo_operation();
+            conv_input_image.fr = fr;
+            conv_input_image.fc = fc;
+            conv_input_image.fi = fi;
+            conv_input_image.fo = fo;
+            conv_input_image.outr = outr;
+            conv_input_image.outc = outc;
+            conv_input_image.mat_rows = mat_rows;
+            conv_input_image.mat_cols = mat_cols;
+        }
+        
+    public:
+        
+        // a pipeline is planned for a fixed input shape
+        conv_pipeline(int _rows, int _cols, int _channels = 1) :
+        in_rows(_rows),
+        in_cols(_cols),
+        in_channels(_channels) {}
+        
+        
+        // current number of output rows
+        int get_rows() const {
+            return (layers.size() == 0) ? in_rows : (layers.back().out_rows / layers.back().strideY);
+        }
+        
+        // current number of output cols
+        int get_cols() const {
+            return (layers.size() == 0) ? in_cols : (layers.back().out_cols / layers.back().strideX);
+        }
+        
+        // current number of output channels
+        int get_channels() const {
+            return (layers.size() == 0) ? in_channels : layers.back().filter->get_ochannels();
+        }
+        
+        // number of values in the intermediate buffer arena
+        size_t arena_size() const {
+            return slot_size(0) + slot_size(1);
+        }
+        
+        
+        // append a convolution layer; padding is {left, top, right, bottom}, dilation and stride are {scaleX, scaleY}
+        void add_layer(filter_tensor<T> &filter,
+                       std::vector<int> padding = {0, 0, 0, 0},
+                       std::vector<int> dilation = {1, 1},
+                       std::vector<int> stride = {1, 1},
+                       typename conv_layer<T>::activation_type activation = conv_layer<T>::NONE) {
+            if (padding.size() != 4 || dilation.size() != 2 || stride.size() != 2) {
+                std::cout << "[Pipeline error] padding needs 4 values, dilation and stride need 2.\n";
+                return;
+            }
+            
+            if (padding[0] < 0 || padding[1] < 0 || padding[2] < 0 || padding[3] < 0) {
+                std::cout << "[Pipeline error] padding must not be negative.\n";
+                return;
+            }
+            
+            if (dilation[0] < 1 || dilation[1] < 1 || stride[0] < 1 || stride[1] < 1) {
+                std::cout << "[Pipeline error] dilation and stride must be at least 1.\n";
+                return;
+            }
+            
+            conv_layer<T> layer(filter, padding, dilation, stride, activation);
+            
+            if (filter.get_ichannels() != get_channels()) {
+                std::cout << "[Pipeline error] filter input channels do not match the layer input.\n";
+                return;
+            }
+            
+            // plan the output size of the layer
+            layer.out_rows = get_rows() + layer.top + layer.bottom - layer.filter_rows * layer.dilationY + 1;
+            layer.out_cols = get_cols() + layer.left + layer.right - layer.filter_cols * layer.dilationX + 1;
+            if (layer.out_rows / layer.strideY <= 0 || layer.out_cols / layer.strideX <= 0) {
+                std::cout << "[Pipeline error] layer output would be empty.\n";
+                return;
+            }
+            
+            layers.push_back(layer);
+        }
+        
+        
+        // run all layers on the input image and write the final activation to an output image without lineage
+        // the input's lineage and any matrix2D interpretation built over it are left as they were
+        // returns false, leaving the output untouched, if the pipeline cannot run as planned
+        bool run(image_tensor<T> &input, image_tensor<T> &output) {
+            if (layers.size() == 0) {
+                std::cout << "[Pipeline error] no layers to run.\n";
+                return false;
+            }
+            
+            if (input.get_rows() != in_rows || input.get_cols() != in_cols || input.get_channels() != in_channels) {
+                std::cout << "[Pipeline error] input dimensions do not match.\n";
+                return false;
+            }
+            
+            if (output.get_rows() != get_rows() || output.get_cols() != get_cols() || output.get_channels() != get_channels()) {
+                std::cout << "[Pipeline error] output dimensions do not match.\n";
+                return false;
+            }
+            
+            // a filter reshaped through its lineage after planning no longer fits its layer
+            for (size_t k = 0; k < layers.size(); k++) {
+                if (layers[k].filter->get_irows() != layers[k].filter_rows || layers[k].filter->get_icols() != layers[k].filter_cols) {
+                    std::cout << "[Pipeline error] filter of layer " << k + 1 << " changed size since it was planned.\n";
+                    return false;
+                }
+            }
+            
+            // allocate the arena once and reuse it across runs
+            if (arena.size() != arena_size()) arena.assign(arena_size(), 0);
+            
+            // each layer reads the previous slot through a strided view and writes the other slot, or the output if it is the last
+            for (size_t k = 0; k < layers.size(); k++) {
+                T* buffer = (k < arena_layers()) ? slot(k) : output.data;
+                if (k == 0) {
+                    run_layer(layers[0], input, buffer);
+                    continue;
+                }
+                image_tensor<T> prev(slot(k - 1), layers[k - 1].out_rows, layers[k - 1].out_cols, layers[k - 1].filter->get_ochannels());
+                prev.downsample_image(layers[k - 1].strideX, layers[k - 1].strideY);
+                run_layer(layers[k], prev, buffer);
+            }
+            
+            // a strided last layer is copied out of the arena
+            if (arena_layers() == layers.size()) {
+                image_tensor<T> last(slot(layers.size() - 1), layers.back().out_rows, layers.back().out_cols, get_channels());
+                last.downsample_image(layers.back().strideX, layers.back().strideY);
+                for (int c = 0; c < get_channels(); c++) {
+                    for (int i = 0; i < get_rows(); i++) {
+                        for (int j = 0; j < get_cols(); j++) {
+                            output.data[(c * get_rows() + i) * get_cols() + j] = last.at(c, i, j);
+                        }
+                    }
+                }
+            }
+            return true;
+        }
+        
+    };
+    
+    
 };
 
 #endif /* conv_utils_h */
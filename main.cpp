@@ -1,8 +1,10 @@
 #include <iostream>
 #include "conv_utils.h"
+#include "batch_utils.h"
 #include "tensor.h"
 #include <unordered_map>
 #include <fstream>
+#include <sstream>
 
 // input image shape
 #define Ni 2
@@ -151,5 +153,77 @@ int main() {
     }
     
     
+    // demonstrate incremental update: blank out a patch of the input and recompute only the affected outputs
+    for(int i = 20; i <= 24; i++){
+        for(int j = 10; j <= 14; j++){
+            mario.data[i * 47 + j] = 0;
+        }
+    }
+    cu::update_matrix2D(ff_mat, mario_mat, luigi_mat, mario, 10, 20, 14, 24);
+    
+    // compare against a full recompute
+    cu::image_tensor<int> luigi_full(luigi.get_rows(), luigi.get_cols(), 1);
+    cu::matrix2D<int> luigi_full_mat(luigi_full);
+    cu::mult_matrix2D(ff_mat, mario_mat, luigi_full_mat);
+    bool update_matches = true;
+    for(size_t i = 0; i < luigi.size(); i++){
+        if(luigi.data[i] != luigi_full.data[i]) update_matches = false;
+    }
+    std::cout << "\nIncremental update " << (update_matches ? "matches" : "does not match") << " full convolution\n";
+    
+    
+    // demonstrate pipeline: rerun both convolutions as conv_pipeline layers out of one arena
+    cu::conv_pipeline<int> iimage_pipeline(iimage.get_rows(), iimage.get_cols(), Ni);
+    iimage_pipeline.add_layer(ffilter, {0, 0, 0, 0}, {1, 1}, {Sr, Sc});
+    cu::image_tensor<int> oimage_pipelined(iimage_pipeline.get_rows(), iimage_pipeline.get_cols(), iimage_pipeline.get_channels());
+    bool pipeline_matches = iimage_pipeline.run(iimage, oimage_pipelined);
+    
+    mario.undo_operation();
+    cu::conv_pipeline<int> mario_pipeline(mario.get_rows(), mario.get_cols(), 1);
+    mario_pipeline.add_layer(ff, {1, 1, 1, 1});
+    cu::image_tensor<int> luigi_pipelined(mario_pipeline.get_rows(), mario_pipeline.get_cols(), 1);
+    pipeline_matches = mario_pipeline.run(mario, luigi_pipelined) && pipeline_matches;
+    
+    pipeline_matches = pipeline_matches && oimage_pipelined.get_rows() == oimage.get_rows() && oimage_pipelined.get_cols() == oimage.get_cols();
+    for(int c = 0; pipeline_matches && c < No; c++){
+        for(int i = 0; i < oimage.get_rows(); i++){
+            for(int j = 0; j < oimage.get_cols(); j++){
+                if(oimage_pipelined.at(c, i, j) != oimage.at(c, i, j)) pipeline_matches = false;
+            }
+        }
+    }
+    for(size_t i = 0; pipeline_matches && i < luigi.size(); i++){
+        if(luigi_pipelined.data[i] != luigi.data[i]) pipeline_matches = false;
+    }
+    std::cout << "Pipeline " << (pipeline_matches ? "matches" : "does not match") << " hand-built convolutions (arena of " << mario_pipeline.arena_size() << " values)\n";
+    
+    
+    // demonstrate batch processing: stream copies of the original image through load, pad, convolve and emit stages
+    std::stringstream mario_frames;
+    for(int f = 0; f < 8; f++){
+        for(int i = 0; i < 62 * 47; i++) mario_frames << img_data[i] << "\n";
+    }
+    
+    // reference output of a single frame
+    cu::image_tensor<int> mario_frame(62, 47, 1);
+    mario_frame.initialize(tensor<int>::init_type::RANDOM, 0, img_data);
+    cu::image_tensor<int> luigi_frame(mario_pipeline.get_rows(), mario_pipeline.get_cols(), 1);
+    mario_pipeline.run(mario_frame, luigi_frame);
+    
+    std::vector<bool> frames_seen(8, false);
+    bool batch_matches = true;
+    cu::batch_pipeline<int> mario_batch(ff, 2, 2);
+    mario_batch.run([&] { return cu::read_image<int>(mario_frames, 62, 47); },
+                    [](cu::image_tensor<int> &frame) { frame.pad_image(1, 1, 1, 1); },
+                    [&](size_t index, cu::image_tensor<int> &frame) {
+                        frames_seen[index] = true;
+                        for(size_t i = 0; i < frame.size(); i++){
+                            if(frame.data[i] != luigi_frame.data[i]) batch_matches = false;
+                        }
+                    });
+    int frames_done = std::count(frames_seen.begin(), frames_seen.end(), true);
+    std::cout << "Batch of " << frames_done << " frames " << (batch_matches ? "matches" : "does not match") << " single convolution\n";
+    
+    
     return 0;
 }
@@ -2,6 +2,7 @@
 #define tensor_h
 
 #include <vector>
+#include <algorithm>
 #include <cstdarg>
 
 // Generic tensor object of arbitrarily many dimensions
@@ -10,27 +11,20 @@ class tensor {
     std::vector<size_t> shape_sizes;        // shape sizes
     std::vector<size_t> cum_sizes;          // cumulative sizes
     size_t _size, _dims;                    // size of the underlying array and interpreted dimensions of the tensor
+    bool owns_data;                         // whether data was allocated by this tensor
     
-public:
-    // available publically to allow direct modifications
-    T* data;
-    
-    
-    // specify number of dimensions, followed by length of each dimension
-    tensor(size_t dims, ...) {
+    // obtain shape information from the variable list of dimension lengths
+    void init_shape(size_t dims, va_list arglist) {
         
         // update dimensions
         _dims = dims;
         
         // obtain shape information
         _size = 1;
-        va_list arglist;
-        va_start(arglist, dims);
         for (int i = 0; i < dims; i++) {
             shape_sizes.emplace_back(va_arg(arglist, int));
             _size *= shape_sizes.back();
         }
-        va_end(arglist);
         
         // obtain cumulative sizes to help dereference
         cum_sizes.emplace_back(1);
@@ -38,15 +32,40 @@ public:
             cum_sizes.emplace_back(cum_sizes.back() * shape_sizes[i]);
         }
         std::reverse(cum_sizes.begin(), cum_sizes.end());
+    }
+    
+    
+public:
+    // available publically to allow direct modifications
+    T* data;
+    
+    
+    // specify number of dimensions, followed by length of each dimension
+    tensor(size_t dims, ...) : owns_data(true) {
+        va_list arglist;
+        va_start(arglist, dims);
+        init_shape(dims, arglist);
+        va_end(arglist);
         
         // allocate space for data
         data = new T[_size];
     }
     
     
+    // view over an existing buffer of at least size() elements, which the tensor does not free
+    tensor(T* buffer, size_t dims, ...) : owns_data(false) {
+        va_list arglist;
+        va_start(arglist, dims);
+        init_shape(dims, arglist);
+        va_end(arglist);
+        
+        data = buffer;
+    }
+    
+    
     // delete underlying data on object deletion
     ~tensor() {
-        delete data;
+        if (owns_data) delete[] data;
     }
     
     